@@ -0,0 +1,360 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "blobcache.h"
+
+// Number of buckets of the hash table, must be a power of 2.
+#define FG_BLOBCACHE_BUCKETS 4096
+
+struct fg_blob_entry {
+  git_oid oid;
+  void *data;
+  size_t size;
+
+  // Chain of entries which are in the same bucket.
+  struct fg_blob_entry *next;
+
+  // Doubly linked list ordered from the most to the least recently used.
+  struct fg_blob_entry *newer;
+  struct fg_blob_entry *older;
+
+  // Number of threads copying the content outside the lock. An entry evicted
+  // while pinned is removed from the cache, and freed by the last unpin.
+  unsigned pins;
+  int evicted;
+};
+
+// Blob which is being looked up by one thread, while others are waiting for it.
+struct fg_blob_pending {
+  git_oid oid;
+  struct fg_blob_pending *next;
+
+  // Non-zero once the lookup is completed.
+  int done;
+  // Blob shared with the waiting threads, NULL if the lookup failed. It is
+  // kept alive until all waiting threads copied what they need, such as blobs
+  // which are too large for the cache are inflated only once.
+  git_blob *blob;
+  unsigned waiters;
+};
+
+struct fg_blobcache {
+  pthread_mutex_t lock;
+  // Signaled each time a pending lookup is completed, and each time the last
+  // waiting thread is done with a pending blob.
+  pthread_cond_t loaded;
+  struct fg_blob_pending *pending;
+
+  struct fg_blob_entry *buckets[FG_BLOBCACHE_BUCKETS];
+  struct fg_blob_entry *newest;
+  struct fg_blob_entry *oldest;
+
+  size_t used;
+  size_t maxBytes;
+};
+
+static size_t
+fg_blobcache_bucket(const git_oid *oid)
+{
+  // Object identifiers are hashes, any of their bytes is well distributed.
+  size_t h = ((size_t) oid->id[0] << 8) | oid->id[1];
+  return h & (FG_BLOBCACHE_BUCKETS - 1);
+}
+
+static struct fg_blob_entry **
+fg_blobcache_find(fg_blobcache *cache, const git_oid *oid)
+{
+  struct fg_blob_entry **it = &cache->buckets[fg_blobcache_bucket(oid)];
+  while (*it && git_oid_cmp(&(*it)->oid, oid) != 0)
+    it = &(*it)->next;
+  return it;
+}
+
+static void
+fg_blobcache_unlink(fg_blobcache *cache, struct fg_blob_entry *entry)
+{
+  if (entry->newer)
+    entry->newer->older = entry->older;
+  else
+    cache->newest = entry->older;
+  if (entry->older)
+    entry->older->newer = entry->newer;
+  else
+    cache->oldest = entry->newer;
+  entry->newer = entry->older = NULL;
+}
+
+static void
+fg_blobcache_push(fg_blobcache *cache, struct fg_blob_entry *entry)
+{
+  entry->newer = NULL;
+  entry->older = cache->newest;
+  if (cache->newest)
+    cache->newest->newer = entry;
+  else
+    cache->oldest = entry;
+  cache->newest = entry;
+}
+
+static void
+fg_blobcache_entry_free(struct fg_blob_entry *entry)
+{
+  free(entry->data);
+  free(entry);
+}
+
+static void
+fg_blobcache_evict(fg_blobcache *cache, size_t needed)
+{
+  while (cache->oldest && cache->used + needed > cache->maxBytes) {
+    struct fg_blob_entry *entry = cache->oldest;
+    struct fg_blob_entry **it = fg_blobcache_find(cache, &entry->oid);
+    assert(*it == entry);
+    *it = entry->next;
+    fg_blobcache_unlink(cache, entry);
+    cache->used -= entry->size;
+    if (entry->pins > 0)
+      entry->evicted = 1;
+    else
+      fg_blobcache_entry_free(entry);
+  }
+}
+
+int
+fg_blobcache_new(fg_blobcache **out, size_t maxBytes)
+{
+  fg_blobcache *cache = calloc(1, sizeof(fg_blobcache));
+  if (!cache)
+    return -1;
+
+  if (pthread_mutex_init(&cache->lock, NULL)) {
+    free(cache);
+    return -2;
+  }
+  if (pthread_cond_init(&cache->loaded, NULL)) {
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+    return -2;
+  }
+
+  cache->maxBytes = maxBytes;
+  *out = cache;
+  return 0;
+}
+
+void
+fg_blobcache_free(fg_blobcache *cache)
+{
+  if (!cache)
+    return;
+  cache->maxBytes = 0;
+  fg_blobcache_evict(cache, 0);
+  assert(cache->oldest == NULL);
+  assert(cache->pending == NULL);
+  pthread_cond_destroy(&cache->loaded);
+  pthread_mutex_destroy(&cache->lock);
+  free(cache);
+}
+
+size_t
+fg_blobcache_max_size(const fg_blobcache *cache)
+{
+  // Keep a single blob from flushing the whole cache.
+  return cache->maxBytes / 4;
+}
+
+int
+fg_blobcache_contains(fg_blobcache *cache, const git_oid *oid)
+{
+  pthread_mutex_lock(&cache->lock);
+  int found = *fg_blobcache_find(cache, oid) != NULL;
+  pthread_mutex_unlock(&cache->lock);
+  return found;
+}
+
+int
+fg_blobcache_insert(fg_blobcache *cache, const git_oid *oid, const void *data, size_t size)
+{
+  if (size > fg_blobcache_max_size(cache))
+    return -1;
+
+  // Copy the content outside the lock.
+  struct fg_blob_entry *entry = calloc(1, sizeof(struct fg_blob_entry));
+  if (!entry)
+    return -2;
+  entry->data = malloc(size ? size : 1);
+  if (!entry->data) {
+    free(entry);
+    return -2;
+  }
+  memcpy(entry->data, data, size);
+  entry->size = size;
+  git_oid_cpy(&entry->oid, oid);
+
+  pthread_mutex_lock(&cache->lock);
+  struct fg_blob_entry **it = fg_blobcache_find(cache, oid);
+  if (*it) {
+    // Another thread already added the same content.
+    pthread_mutex_unlock(&cache->lock);
+    free(entry->data);
+    free(entry);
+    return 0;
+  }
+
+  fg_blobcache_evict(cache, size);
+  // The eviction might have changed the chain of the bucket.
+  it = fg_blobcache_find(cache, oid);
+  *it = entry;
+  fg_blobcache_push(cache, entry);
+  cache->used += size;
+  pthread_mutex_unlock(&cache->lock);
+  return 0;
+}
+
+static struct fg_blob_pending **
+fg_blobcache_find_pending(fg_blobcache *cache, const git_oid *oid)
+{
+  struct fg_blob_pending **it = &cache->pending;
+  while (*it && git_oid_cmp(&(*it)->oid, oid) != 0)
+    it = &(*it)->next;
+  return it;
+}
+
+// Find an entry and mark it as recently used. Called with the lock held.
+static struct fg_blob_entry *
+fg_blobcache_touch(fg_blobcache *cache, const git_oid *oid)
+{
+  struct fg_blob_entry *entry = *fg_blobcache_find(cache, oid);
+  if (entry) {
+    fg_blobcache_unlink(cache, entry);
+    fg_blobcache_push(cache, entry);
+  }
+  return entry;
+}
+
+// Release an entry pinned while copying its content.
+static void
+fg_blobcache_unpin(fg_blobcache *cache, struct fg_blob_entry *entry)
+{
+  pthread_mutex_lock(&cache->lock);
+  assert(entry->pins > 0);
+  entry->pins -= 1;
+  int release = entry->pins == 0 && entry->evicted;
+  pthread_mutex_unlock(&cache->lock);
+  if (release)
+    fg_blobcache_entry_free(entry);
+}
+
+// Copy the content of the blob looked up by another thread. Called with the
+// lock held, which is released while copying.
+static int
+fg_blobcache_wait(void *dest, fg_blobcache *cache, struct fg_blob_pending *pending, size_t fileOffset, size_t size)
+{
+  pending->waiters += 1;
+  while (!pending->done)
+    pthread_cond_wait(&cache->loaded, &cache->lock);
+  pthread_mutex_unlock(&cache->lock);
+
+  int exit = 0;
+  if (!pending->blob) {
+    exit = -1;
+  } else if (dest) {
+    assert(fileOffset + size <= (size_t) git_blob_rawsize(pending->blob));
+    memcpy(dest, (const char *) git_blob_rawcontent(pending->blob) + fileOffset, size);
+  }
+
+  pthread_mutex_lock(&cache->lock);
+  pending->waiters -= 1;
+  if (pending->waiters == 0)
+    pthread_cond_broadcast(&cache->loaded);
+  return exit;
+}
+
+static int
+fg_blobcache_fetch(void *dest, fg_blobcache *cache, git_repository *repo,
+                   const git_oid *oid, size_t fileOffset, size_t size,
+                   fg_blobcache_accept accept, void *payload)
+{
+  pthread_mutex_lock(&cache->lock);
+  struct fg_blob_entry *entry = fg_blobcache_touch(cache, oid);
+  if (entry) {
+    if (!dest) {
+      pthread_mutex_unlock(&cache->lock);
+      return 0;
+    }
+
+    // Pin the entry, such as large copies do not hold the lock while the
+    // content is kept alive.
+    entry->pins += 1;
+    pthread_mutex_unlock(&cache->lock);
+    assert(fileOffset + size <= entry->size);
+    memcpy(dest, (const char *) entry->data + fileOffset, size);
+    fg_blobcache_unpin(cache, entry);
+    return 0;
+  }
+
+  struct fg_blob_pending *other = *fg_blobcache_find_pending(cache, oid);
+  if (other) {
+    int exit = fg_blobcache_wait(dest, cache, other, fileOffset, size);
+    pthread_mutex_unlock(&cache->lock);
+    return exit;
+  }
+
+  // Register the lookup, such as concurrent misses wait for it instead of
+  // inflating the same blob.
+  struct fg_blob_pending pending;
+  memset(&pending, 0, sizeof(struct fg_blob_pending));
+  git_oid_cpy(&pending.oid, oid);
+  pending.next = cache->pending;
+  cache->pending = &pending;
+  pthread_mutex_unlock(&cache->lock);
+
+  int exit = 0;
+  git_blob *blob = NULL;
+  if (git_blob_lookup(&blob, repo, oid) == 0) {
+    size_t blobSize = git_blob_rawsize(blob);
+    if (dest) {
+      assert(fileOffset + size <= blobSize);
+      memcpy(dest, (const char *) git_blob_rawcontent(blob) + fileOffset, size);
+    }
+    if (blobSize <= fg_blobcache_max_size(cache) &&
+        (!accept || accept(oid, blobSize, payload)))
+      fg_blobcache_insert(cache, oid, git_blob_rawcontent(blob), blobSize);
+  } else {
+    blob = NULL;
+    exit = -1;
+  }
+
+  // Share the blob with the waiting threads, and wait for them to be done
+  // with it before freeing it.
+  pthread_mutex_lock(&cache->lock);
+  pending.blob = blob;
+  pending.done = 1;
+  pthread_cond_broadcast(&cache->loaded);
+  while (pending.waiters > 0)
+    pthread_cond_wait(&cache->loaded, &cache->lock);
+  struct fg_blob_pending **it = fg_blobcache_find_pending(cache, oid);
+  assert(*it == &pending);
+  *it = pending.next;
+  pthread_mutex_unlock(&cache->lock);
+
+  if (blob)
+    git_blob_free(blob);
+  return exit;
+}
+
+int
+fg_blobcache_read(void *dest, fg_blobcache *cache, git_repository *repo,
+                  const git_oid *oid, size_t fileOffset, size_t size)
+{
+  return fg_blobcache_fetch(dest, cache, repo, oid, fileOffset, size, NULL, NULL);
+}
+
+int
+fg_blobcache_load(fg_blobcache *cache, git_repository *repo, const git_oid *oid,
+                  fg_blobcache_accept accept, void *payload)
+{
+  return fg_blobcache_fetch(NULL, cache, repo, oid, 0, 0, accept, payload);
+}
@@ -0,0 +1,60 @@
+#include <stddef.h>
+#include <git2.h>
+
+struct fg_blobcache;
+typedef struct fg_blobcache fg_blobcache;
+
+// Allocate a cache of blob contents, indexed by object identifiers.
+//
+// The cache is safe to use from multiple threads. Entries are evicted in least
+// recently used order once the total size of the cached contents goes beyond
+// maxBytes.
+//
+// @param out Pointer where to store the cache.
+//
+// @param maxBytes Upper bound of the memory used by blob contents.
+//
+// @return 0 or an error code.
+int fg_blobcache_new(fg_blobcache **out, size_t maxBytes);
+
+// Free the cache and all the contents it holds.
+void fg_blobcache_free(fg_blobcache *cache);
+
+// Largest content which can be added to the cache.
+size_t fg_blobcache_max_size(const fg_blobcache *cache);
+
+// Non-zero if the content of the blob is present in the cache.
+int fg_blobcache_contains(fg_blobcache *cache, const git_oid *oid);
+
+// Add a copy of the content of a blob to the cache. Adding a blob which is
+// already present is not an error.
+//
+// @return 0 or an error code.
+int fg_blobcache_insert(fg_blobcache *cache, const git_oid *oid, const void *data, size_t size);
+
+// Copy the content of a blob from an offset and for a specific size, and look
+// it up in the repository if it is not cached. Concurrent misses for the same
+// blob are coalesced, such as a blob is inflated by a single thread while the
+// others are waiting to copy their part of it, even if the blob is too large
+// for the cache.
+//
+// @return 0 or an error code.
+int fg_blobcache_read(void *dest, fg_blobcache *cache, git_repository *repo,
+                      const git_oid *oid, size_t fileOffset, size_t size);
+
+// Callback used by fg_blobcache_load to decide if a blob is added to the cache.
+//
+// @param size  Size of the content of the blob.
+// @param payload  Untyped data transfered from fg_blobcache_load.
+//
+// @return Non-zero to add the blob to the cache.
+typedef int (*fg_blobcache_accept)(const git_oid *oid, size_t size, void *payload);
+
+// Load a blob in the cache, as fg_blobcache_read does, without copying it.
+//
+// @param accept  Function called with the size of the blob before adding it.
+// @param payload  Untyped data transfered to the callback.
+//
+// @return 0 or an error code.
+int fg_blobcache_load(fg_blobcache *cache, git_repository *repo, const git_oid *oid,
+                      fg_blobcache_accept accept, void *payload);
@@ -8,6 +8,27 @@
 : ${GIT2_CFLAGS=$(pkg-config --cflags libgit2)}
 : ${GIT2_LDFLAGS=$(pkg-config --libs libgit2)}
 
+# Build configuration, either "debug" or "release".
+: ${BUILD=debug}
+case "$BUILD" in
+  debug)
+    : ${OPT_CFLAGS=-O0 -ggdb3}
+    : ${OPT_LDFLAGS=}
+    ;;
+  release)
+    # Keep the debug symbols, such as profilers can still attribute samples.
+    : ${OPT_CFLAGS=-O3 -g -DNDEBUG -flto}
+    : ${OPT_LDFLAGS=-flto=auto}
+    ;;
+  *)
+    echo "configure.sh: unknown BUILD=$BUILD, expected debug or release." >&2
+    exit 1
+    ;;
+esac
+
+# Directory where the profile-guided optimization data are recorded.
+: ${PGO_DIR=$(pwd)/_pgo}
+
 cat > config.mk <<EOF
 BUILDDIR=$BUILDDIR
 INSTDIR=$INSTDIR
@@ -16,5 +37,9 @@ FUSE_CFLAGS=$FUSE_CFLAGS
 FUSE_LDFLAGS=$FUSE_LDFLAGS
 GIT2_CFLAGS=$GIT2_CFLAGS
 GIT2_LDFLAGS=$GIT2_LDFLAGS
+BUILD=$BUILD
+OPT_CFLAGS=$OPT_CFLAGS
+OPT_LDFLAGS=$OPT_LDFLAGS
+PGO_DIR=$PGO_DIR
 EOF
 
@@ -0,0 +1,85 @@
+#!/bin/sh
+#
+# Check the /@diff directory with lsR. Generate a repository with a base and a
+# branch which add, remove, modify and change the type of files, and compare
+# the names listed by lsR in each directory of /@diff/master..topic with the
+# names reported by git diff --name-only.
+#
+# Exit with a non-zero status if any listing differs.
+#
+# usage: diffcheck.sh <lsR> <workdir>
+
+set -e
+
+LSR=$1
+WORKDIR=$2
+
+mkdir -p "$WORKDIR"
+rm -rf "$WORKDIR/diff"
+git init -q "$WORKDIR/diff"
+cd "$WORKDIR/diff"
+git symbolic-ref HEAD refs/heads/master
+git config user.name diffcheck
+git config user.email diffcheck@localhost
+
+mkdir -p dir/sub gone
+echo same > same
+echo base > modified
+echo removed > removed
+echo file > filetodir
+echo mode > mode
+ln -s same linktofile
+echo same > dir/sub/same
+echo base > dir/sub/modified
+echo removed > gone/removed
+git add -A
+git commit -q -m base
+
+git checkout -q -b topic
+echo topic > modified
+git rm -q removed filetodir linktofile
+mkdir filetodir
+echo file > filetodir/file
+echo link > linktofile
+chmod +x mode
+echo added > added
+echo topic > dir/sub/modified
+echo added > dir/sub/added
+git rm -q -r gone
+git add -A
+git commit -q -m topic
+
+# Print the names listed by lsR for the directory queried in the file $1.
+listed() {
+  awk '
+    /^-> Is a directory containing:$/ { listing = 1; next; }
+    listing && /^\t/ { sub(/^\t/, ""); if ($0 != "." && $0 != "..") print; }' "$1" | sort
+}
+
+# Print the names of the entries of the directory $1 which differ, as they are
+# expected to be listed under /@diff.
+expected() {
+  git diff --name-only master topic -- "$1" | awk -v dir="$1" '
+    {
+      if (dir != ".") $0 = substr($0, length(dir) + 2);
+      sub(/\/.*/, "");
+      print;
+    }' | sort -u
+}
+
+status=0
+for dir in . dir dir/sub filetodir gone; do
+  path=/@diff/master..topic
+  [ "$dir" = . ] || path="$path/$dir"
+  out="$WORKDIR/diff-$(echo "$dir" | tr ./ r-).out"
+  "$LSR" "$(pwd)" "$path" > "$out"
+  listed "$out" > "$out.listed"
+  expected "$dir" > "$out.expected"
+  if ! diff -u "$out.expected" "$out.listed"; then
+    echo "FAIL: $path: lsR listing differs from git diff --name-only" >&2
+    status=1
+  else
+    echo "$path $(wc -l < "$out.listed") entries"
+  fi
+done
+exit $status
@@ -3,6 +3,7 @@
 #include <string.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <stdlib.h>
 
 #define FUSE_USE_VERSION 25
 
@@ -10,8 +11,13 @@
 #include <fuse_opt.h>
 
 #include "gitstat.h"
+#include "blobcache.h"
+#include "readahead.h"
 
 git_repository *fg_repository();
+fg_blobcache *fg_cache();
+fg_readahead *fg_ra();
+int fg_oid_inodes();
 
 
 static int
@@ -26,6 +32,8 @@ fg_getattr(const char *path, struct stat *stbuf)
 		return -ENOENT;
 
 	memcpy(stbuf, fg_file_stat(file), sizeof(struct stat));
+	if (fg_oid_inodes())
+		stbuf->st_ino = fg_file_ino(file);
 
 	// Copy current user info, should get this out of the the stat of the
 	// repository instead of fuse_get_context.
@@ -47,14 +55,30 @@ struct readdir_payload
 };
 
 static int
-fg_readdir_cb(const fg_stats *dir, git_repository *repo, const char *relName, void *payload)
+fg_readdir_cb(const fg_stats *dir, git_repository *repo, const char *relName,
+							const git_oid *oid, git_filemode_t mode, void *payload)
 {
 	struct readdir_payload *rd_payload = (struct readdir_payload *) payload;
 	const struct stat *st = NULL; // Not needed, but will cause more lookup.
 	int offset = 0; // Offset of the current entry ?!
 
-  if (strcmp(".", relName) == 0)
-    st = fg_file_stat(dir);
+	// With use_ino, fuse reports the inode number of this stat, which should
+	// match the one reported by fg_getattr. The parent directory is left
+	// unknown, as it is not resolved here.
+	struct stat entry;
+	if (strcmp(".", relName) == 0) {
+		memcpy(&entry, fg_file_stat(dir), sizeof(struct stat));
+		if (fg_oid_inodes())
+			entry.st_ino = fg_file_ino(dir);
+		st = &entry;
+	} else if (fg_oid_inodes() && strcmp("..", relName) != 0) {
+		memset(&entry, 0, sizeof(struct stat));
+		entry.st_ino = fg_file_child_ino(dir, relName, oid, mode);
+		// Git file modes use the same file type bits as stat.
+		if (mode != GIT_FILEMODE_COMMIT)
+			entry.st_mode = mode & S_IFMT;
+		st = &entry;
+	}
 	return rd_payload->filler(rd_payload->buf, relName, st, offset);
 }
 
@@ -83,6 +107,8 @@ fg_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
 		.filler = filler
 	};
 	fg_file_list(file, repo, &fg_readdir_cb, &rd_payload);
+	if (fg_ra())
+		fg_readahead_readdir(fg_ra(), repo, path, file);
 	fg_stats_free(file);
 	return 0;
 }
@@ -113,6 +139,9 @@ fg_open(const char *path, struct fuse_file_info *fi)
 		return -EACCES;
 	}
 
+	if (fg_ra() && S_ISREG(st->st_mode))
+		fg_readahead_open(fg_ra(), path);
+
 	fg_stats_free(file);
 	return 0;
 }
@@ -145,8 +174,9 @@ fg_read(const char *path, char *buf, size_t size, off_t offset,
 		if (offset + size > st->st_size)
 			size = st->st_size - offset;
 
-		// Copy the content out of the git repository.
-		if (fg_file_cpy(buf, repo, file, offset, size)) {
+		// Copy the content out of the cache, or out of the git repository. Reads
+		// of a blob which is being inflated by another thread wait for it.
+		if (fg_blobcache_read(buf, fg_cache(), repo, fg_file_oid(file), offset, size)) {
 			fg_stats_free(file);
 			return -ENOENT;
 		}
@@ -170,6 +200,25 @@ struct fg_options {
 	// Keep a global instance of the repository open for the duration of the
 	// mount-point.
 	git_repository *repo;
+
+	// Size of the cache of blob contents, in MiB.
+	unsigned blobCacheSize;
+	fg_blobcache *cache;
+
+	// Number of blobs prefetched ahead of sequential visits of directories, 0
+	// to disable the readahead.
+	unsigned readahead;
+	// Number of threads used to prefetch blobs.
+	unsigned readaheadThreads;
+	fg_readahead *ra;
+
+	// Number of trees kept alive by gitstat.c, 0 to disable, and upper bound
+	// of their memory in MiB.
+	unsigned treeCache;
+	unsigned treeCacheSize;
+
+	// Non-zero if files with the same content share their inode number.
+	int oidInodes;
 };
 
 struct fg_options options;
@@ -180,6 +229,30 @@ fg_repository()
 	return options.repo;
 }
 
+fg_blobcache *
+fg_cache()
+{
+	return options.cache;
+}
+
+fg_readahead *
+fg_ra()
+{
+	return options.ra;
+}
+
+int
+fg_oid_inodes()
+{
+	return options.oidInodes;
+}
+
+// Default size of read requests and of the kernel readahead window.
+#define FG_MAX_READ 1048576
+
+#define FG_XSTR(x) #x
+#define FG_STR(x) FG_XSTR(x)
+
 // macro to define options
 #define FG_CLI_KEY(t, p, v) { t, offsetof(struct fg_options, p), v }
 
@@ -189,11 +262,49 @@ static struct fuse_opt fg_cli[] =
 	FG_CLI_KEY("--repository=%s", repoName, 0),
 	FG_CLI_KEY("-r %s", repoName, 0),
 
+	// Tune the cache of blobs and the readahead.
+	FG_CLI_KEY("--blob-cache=%u", blobCacheSize, 0),
+	FG_CLI_KEY("--readahead=%u", readahead, 0),
+	FG_CLI_KEY("--readahead-threads=%u", readaheadThreads, 0),
+
+	// Tune the cache of trees.
+	FG_CLI_KEY("--tree-cache=%u", treeCache, 0),
+	FG_CLI_KEY("--tree-cache-size=%u", treeCacheSize, 0),
+
+	// Derive inode numbers from the content of files.
+	FG_CLI_KEY("--oid-inodes", oidInodes, 1),
+
 	// No more arguments.
 	FUSE_OPT_END
 };
 
+// Worker threads are started once fuse is initialized, as threads created
+// before would not survive the daemonization.
+static void *
+fg_init(void)
+{
+	if (options.readahead && options.readaheadThreads) {
+		if (fg_readahead_new(&options.ra, options.repoName, options.cache,
+					options.readaheadThreads, options.readahead)) {
+			fprintf(stderr, "fusegitif: cannot start the readahead of %s\n",
+					options.repoName);
+			options.ra = NULL;
+		}
+	}
+	return NULL;
+}
+
+static void
+fg_destroy(void *data)
+{
+	(void) data;
+	fg_readahead_free(options.ra);
+	options.ra = NULL;
+}
+
 static struct fuse_operations fg_oper = {
+	.init = fg_init,
+	.destroy = fg_destroy,
 	.getattr = fg_getattr,
 	.readdir = fg_readdir,
 	.open = fg_open,
@@ -206,6 +317,11 @@ int main(int argc, char *argv[])
 
 	/* clear structure that holds our options */
 	memset(&options, 0, sizeof(struct fg_options));
+	options.blobCacheSize = 64;
+	options.readahead = 16;
+	options.readaheadThreads = 4;
+	options.treeCache = 1024;
+	options.treeCacheSize = 32;
 	if (fuse_opt_parse(&args, &options, fg_cli, NULL) == -1) {
 		// Error parsing options
 		return -1;
@@ -217,17 +333,57 @@ int main(int argc, char *argv[])
 		return -2;
 	}
 
+	// Let the kernel send large read requests and read ahead of sequential
+	// accesses, such that large files are streamed with few round trips, each
+	// of which has to lookup the blob again. These are inserted before the
+	// arguments of the user, such as they can be overriden with -o.
+	if (fuse_opt_insert_arg(&args, 1, "-omax_read=" FG_STR(FG_MAX_READ)
+				",max_readahead=" FG_STR(FG_MAX_READ) ",async_read") == -1) {
+		fuse_opt_free_args(&args);
+		return -1;
+	}
+
+	// Let fuse report the inode numbers given by fg_getattr.
+	if (options.oidInodes && fuse_opt_add_arg(&args, "-ouse_ino") == -1) {
+		fuse_opt_free_args(&args);
+		return -1;
+	}
+
+	if (fg_tree_cache_init(options.treeCache,
+				(size_t) options.treeCacheSize << 20)) {
+		fuse_opt_free_args(&args);
+		return -5;
+	}
+
+	// Fuse changes the working directory when it daemonizes, make the path of
+	// the repository absolute before the readahead workers open it.
+	char *repoPath = realpath(options.repoName, NULL);
+	if (repoPath == NULL) {
+		fuse_opt_free_args(&args);
+		return -3;
+	}
+	free(options.repoName);
+	options.repoName = repoPath;
+
 	if (git_repository_open(&options.repo, options.repoName)) {
 		// Cannot open the repository.
 		fuse_opt_free_args(&args);
 		return -3;
 	}
 
+	if (fg_blobcache_new(&options.cache, (size_t) options.blobCacheSize << 20)) {
+		git_repository_free(options.repo);
+		fuse_opt_free_args(&args);
+		return -4;
+	}
+
 	int ret = fuse_main(args.argc, args.argv, &fg_oper);
 
 //	if (ret) printf("\n");
 
 	// Clean-up
+	fg_blobcache_free(options.cache);
+	fg_tree_cache_free();
 	git_repository_free(options.repo);
 	// The name has been allocated by fuse.
 	free(options.repoName);
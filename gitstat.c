@@ -2,9 +2,20 @@
 #include <string.h>
 #include <errno.h>
 #include <assert.h>
+#include <stdint.h>
+#include <pthread.h>
 
 #include "gitstat.h"
 
+// Preferred I/O size reported in the stats of files.
+#define FG_BLKSIZE (128 * 1024)
+
+// Virtual directory containing the differences between branches.
+#define FG_DIFF_DIR "/@diff"
+
+// Number of directory listings of differences which are cached.
+#define FG_DIFF_CACHE 256
+
 struct fg_stats {
   char *path;
   // Name of the object inside the branch.
@@ -16,8 +27,166 @@ struct fg_stats {
 
   // Object Identifier
   git_oid oid;
+
+  // Non-zero for files located under FG_DIFF_DIR.
+  int diff;
+  // Non-zero if the directory is compared against the base tree.
+  int hasBase;
+  // Object Identifier of the same directory in the base branch of the diff.
+  git_oid base;
+};
+
+// Trees which are kept alive by the tree cache. Each slot is selected by the
+// object identifier, and the previous tree of the slot is replaced once it is
+// no longer used.
+struct fg_tree_slot {
+  git_repository *repo;
+  git_oid oid;
+  git_tree *tree;
+  // Estimated memory used by the tree.
+  size_t bytes;
+  // Number of lookups which have not been released yet.
+  unsigned refs;
 };
 
+// Estimated memory used by each entry of a tree, as libgit2 does not report
+// the size of its objects.
+#define FG_TREE_ENTRY_BYTES 96
+
+static pthread_mutex_t fg_tree_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct fg_tree_slot *fg_tree_slots = NULL;
+static size_t fg_tree_count = 0;
+static size_t fg_tree_bytes = 0;
+static size_t fg_tree_max_bytes = 0;
+
+int
+fg_tree_cache_init(size_t count, size_t maxBytes)
+{
+  fg_tree_cache_free();
+  if (count == 0)
+    return 0;
+
+  struct fg_tree_slot *slots = calloc(count, sizeof(struct fg_tree_slot));
+  if (!slots)
+    return -1;
+
+  pthread_mutex_lock(&fg_tree_lock);
+  fg_tree_slots = slots;
+  fg_tree_count = count;
+  fg_tree_max_bytes = maxBytes;
+  pthread_mutex_unlock(&fg_tree_lock);
+  return 0;
+}
+
+void
+fg_tree_cache_free(void)
+{
+  pthread_mutex_lock(&fg_tree_lock);
+  for (size_t i = 0; i < fg_tree_count; i++) {
+    assert(fg_tree_slots[i].refs == 0);
+    git_tree_free(fg_tree_slots[i].tree);
+  }
+  free(fg_tree_slots);
+  fg_tree_slots = NULL;
+  fg_tree_count = 0;
+  fg_tree_bytes = 0;
+  pthread_mutex_unlock(&fg_tree_lock);
+}
+
+static struct fg_tree_slot *
+fg_tree_slot(const git_oid *oid)
+{
+  size_t h = ((size_t) oid->id[0] << 16) | ((size_t) oid->id[1] << 8) | oid->id[2];
+  return &fg_tree_slots[h % fg_tree_count];
+}
+
+// Tree returned by fg_tree_lookup, with the slot of the tree cache which
+// holds a reference on it, if any. The ownership cannot be inferred from the
+// tree, as libgit2 returns the same tree for lookups of the same object.
+typedef struct fg_tree_ref {
+  git_tree *tree;
+  struct fg_tree_slot *slot;
+} fg_tree_ref;
+
+#define FG_TREE_REF_INIT { NULL, NULL }
+
+// Lookup a tree, and keep it alive in the tree cache. The tree must be released
+// with fg_tree_release instead of git_tree_free.
+static int
+fg_tree_lookup(fg_tree_ref *out, git_repository *repo, const git_oid *oid)
+{
+  pthread_mutex_lock(&fg_tree_lock);
+  if (fg_tree_count) {
+    struct fg_tree_slot *slot = fg_tree_slot(oid);
+    if (slot->tree && slot->repo == repo && git_oid_cmp(&slot->oid, oid) == 0) {
+      slot->refs += 1;
+      out->tree = slot->tree;
+      out->slot = slot;
+      pthread_mutex_unlock(&fg_tree_lock);
+      return 0;
+    }
+  }
+  pthread_mutex_unlock(&fg_tree_lock);
+
+  git_tree *tree = NULL;
+  int error = git_tree_lookup(&tree, repo, oid);
+  if (error)
+    return error;
+
+  struct fg_tree_slot *owner = NULL;
+  pthread_mutex_lock(&fg_tree_lock);
+  if (fg_tree_count) {
+    struct fg_tree_slot *slot = fg_tree_slot(oid);
+    if (slot->tree && slot->repo == repo && git_oid_cmp(&slot->oid, oid) == 0) {
+      // Another thread added the same tree in the meantime.
+      git_tree_free(tree);
+      tree = slot->tree;
+      slot->refs += 1;
+      owner = slot;
+    } else if (slot->refs == 0) {
+      // Replace the previous tree of the slot, as it is no longer in use,
+      // unless the new tree does not fit in the memory bound.
+      size_t bytes = git_tree_entrycount(tree) * FG_TREE_ENTRY_BYTES;
+      if (fg_tree_bytes - slot->bytes + bytes <= fg_tree_max_bytes) {
+        if (slot->tree)
+          git_tree_free(slot->tree);
+        fg_tree_bytes += bytes - slot->bytes;
+        slot->repo = repo;
+        git_oid_cpy(&slot->oid, oid);
+        slot->bytes = bytes;
+        // The reference of the lookup is given to the slot, and the caller
+        // holds the slot instead.
+        slot->tree = tree;
+        slot->refs = 1;
+        owner = slot;
+      }
+    }
+  }
+  pthread_mutex_unlock(&fg_tree_lock);
+
+  out->tree = tree;
+  out->slot = owner;
+  return 0;
+}
+
+static void
+fg_tree_release(fg_tree_ref *ref)
+{
+  if (!ref->tree)
+    return;
+
+  if (ref->slot) {
+    pthread_mutex_lock(&fg_tree_lock);
+    assert(ref->slot->refs > 0);
+    ref->slot->refs -= 1;
+    pthread_mutex_unlock(&fg_tree_lock);
+  } else {
+    git_tree_free(ref->tree);
+  }
+  ref->tree = NULL;
+  ref->slot = NULL;
+}
+
 void
 fg_stats_free(fg_stats *stats)
 {
@@ -40,7 +209,7 @@ fg_dir_count_subtree(const char *root, const git_tree_entry *entry, void *payloa
 }
 
 static int
-fg_file_byentry(fg_stats **out, git_repository *repo, git_tree_entry *entry)
+fg_file_byentry(fg_stats **out, git_repository *repo, const git_tree_entry *entry)
 {
   const git_oid *oid = git_tree_entry_id(entry);
   git_otype type = git_tree_entry_type(entry);
@@ -54,17 +223,17 @@ fg_file_byentry(fg_stats **out, git_repository *repo, git_tree_entry *entry)
   if (mode == GIT_FILEMODE_TREE) {
     st_mode = S_IFDIR | 0555;
 
-    git_tree *sub = NULL;
-    if (git_tree_lookup(&sub, repo, oid))
+    fg_tree_ref sub = FG_TREE_REF_INIT;
+    if (fg_tree_lookup(&sub, repo, oid))
       return -9;
     // A directory contains '.' which refer to it-self.
     nlink += 1;
     // Add 1 for each sub-directories, which refer to its parent with '..'
-    if (git_tree_walk(sub, &fg_dir_count_subtree, GIT_TREEWALK_PRE, &nlink) < 0) {
-      git_tree_free(sub);
+    if (git_tree_walk(sub.tree, &fg_dir_count_subtree, GIT_TREEWALK_PRE, &nlink) < 0) {
+      fg_tree_release(&sub);
       return -10;
     }
-    git_tree_free(sub);
+    fg_tree_release(&sub);
   }
 
   // Recover the file size of any plain file.
@@ -95,11 +264,12 @@ fg_file_byentry(fg_stats **out, git_repository *repo, git_tree_entry *entry)
   result->stbuf.st_nlink = nlink;
   result->stbuf.st_size = size;
 
-  // It is easier for us if tools can load files in one request instead of
-  // multiple, such that we don't do a lookup again for serving the same file,
-  // so let us lie to the system and inform it that this file is only one block.
-  result->stbuf.st_blksize = size;
-  result->stbuf.st_blocks = 1;
+  // Report the number of 512-bytes blocks used by the content, such as du
+  // reports the size of the file. Large reads are negotiated with the mount
+  // options (see fusegitif.c), so the block size only acts as a hint for the
+  // buffer size used by tools.
+  result->stbuf.st_blksize = FG_BLKSIZE;
+  result->stbuf.st_blocks = (size + 511) / 512;
 
   git_oid_cpy(&result->oid, oid);
 
@@ -108,27 +278,25 @@ fg_file_byentry(fg_stats **out, git_repository *repo, git_tree_entry *entry)
 }
 
 static int
-fg_file_byroot(fg_stats **out, git_repository *repo, git_commit *commit)
+fg_file_bytreeoid(fg_stats **out, git_repository *repo, const git_oid *oid)
 {
-  const git_oid *oid = git_commit_tree_oid(commit);
-
   // Recover the number of hard links of directories.
   // :TODO: Handle submodules.
   // :TODO: This code is shared with the previous function, factor it out.
   int nlink = 1;
   mode_t st_mode = S_IFDIR | 0555;
 
-  git_tree *sub = NULL;
-  if (git_tree_lookup(&sub, repo, oid))
+  fg_tree_ref sub = FG_TREE_REF_INIT;
+  if (fg_tree_lookup(&sub, repo, oid))
     return -9;
   // A directory contains '.' which refer to it-self.
   nlink += 1;
   // Add 1 for each sub-directories, which refer to its parent with '..'
-  if (git_tree_walk(sub, &fg_dir_count_subtree, GIT_TREEWALK_PRE, &nlink) < 0) {
-    git_tree_free(sub);
+  if (git_tree_walk(sub.tree, &fg_dir_count_subtree, GIT_TREEWALK_PRE, &nlink) < 0) {
+    fg_tree_release(&sub);
     return -10;
   }
-  git_tree_free(sub);
+  fg_tree_release(&sub);
 
   // Recover the file size of any plain file.
   size_t size = 0;
@@ -150,15 +318,59 @@ fg_file_byroot(fg_stats **out, git_repository *repo, git_commit *commit)
 }
 
 static int
-fg_file_bytree(fg_stats **out, git_repository *repo, git_tree *tree, const char *path)
+fg_file_byroot(fg_stats **out, git_repository *repo, git_commit *commit)
+{
+  return fg_file_bytreeoid(out, repo, git_commit_tree_oid(commit));
+}
+
+// Find the entry located at path under a tree. Each intermediate tree is
+// looked up through the tree cache, such as the trees of frequently visited
+// paths are not reconstructed on each lookup. The entry is owned by *parent,
+// which must be released with fg_tree_release once the entry is unused.
+static int
+fg_tree_entry_bypath(const git_tree_entry **out, fg_tree_ref *parent, git_repository *repo, const git_oid *rootOid, const char *path)
 {
-  git_tree_entry *entry;
-  if (git_tree_entry_bypath(&entry, tree, path))
+  char *copy = strdup(path);
+  if (!copy)
+    return -3;
+
+  fg_tree_ref tree = FG_TREE_REF_INIT;
+  if (fg_tree_lookup(&tree, repo, rootOid)) {
+    free(copy);
+    return -7;
+  }
+
+  char *save = NULL;
+  char *name = strtok_r(copy, "/", &save);
+  const git_tree_entry *entry = NULL;
+  while (name) {
+    entry = git_tree_entry_byname(tree.tree, name);
+    if (!entry)
+      break;
+
+    name = strtok_r(NULL, "/", &save);
+    if (!name)
+      break;
+
+    fg_tree_ref sub = FG_TREE_REF_INIT;
+    if (git_tree_entry_filemode(entry) != GIT_FILEMODE_TREE ||
+        fg_tree_lookup(&sub, repo, git_tree_entry_id(entry))) {
+      entry = NULL;
+      break;
+    }
+    fg_tree_release(&tree);
+    tree = sub;
+  }
+  free(copy);
+
+  if (!entry) {
+    fg_tree_release(&tree);
     return -8;
+  }
 
-  int exit = fg_file_byentry(out, repo, entry);
-  git_tree_entry_free(entry);
-  return exit;
+  *out = entry;
+  *parent = tree;
+  return 0;
 }
 
 static int
@@ -167,12 +379,14 @@ fg_file_bycommit(fg_stats **out, git_repository *repo, git_commit *commit, const
   if (path[0] == '\0')
     return fg_file_byroot(out, repo, commit);
 
-  git_tree *commitTree = NULL;
-  if (git_commit_tree(&commitTree, commit))
-    return -7;
+  fg_tree_ref parent = FG_TREE_REF_INIT;
+  const git_tree_entry *entry = NULL;
+  int exit = fg_tree_entry_bypath(&entry, &parent, repo, git_commit_tree_oid(commit), path);
+  if (exit)
+    return exit;
 
-  int exit = fg_file_bytree(out, repo, commitTree, path);
-  git_tree_free(commitTree);
+  exit = fg_file_byentry(out, repo, entry);
+  fg_tree_release(&parent);
   return exit;
 }
 
@@ -274,10 +488,176 @@ fg_file_byprefix(fg_stats **out, git_repository *repo, char *path)
   return 0;
 }
 
+// Resolve the name of a local branch to the tree of the commit it targets.
+static int
+fg_branch_tree(git_oid *out, time_t *last, git_repository *repo, const char *name)
+{
+  git_reference *symb = NULL;
+  if (git_branch_lookup(&symb, repo, name, GIT_BRANCH_LOCAL))
+    return -1;
+
+  git_reference *direct = NULL;
+  if (git_reference_resolve(&direct, symb) != 0) {
+    git_reference_free(symb);
+    return -4;
+  }
+  git_reference_free(symb);
+
+  git_commit *commit = NULL;
+  const git_oid *oid = git_reference_oid(direct);
+  if (!oid || git_commit_lookup(&commit, repo, oid)) {
+    git_reference_free(direct);
+    return -6;
+  }
+  git_reference_free(direct);
+
+  git_oid_cpy(out, git_commit_tree_oid(commit));
+  if (last)
+    *last = git_commit_time(commit);
+  git_commit_free(commit);
+  return 0;
+}
+
+// Find a file which differs between two trees. Sub-trees are only compared by
+// their object identifiers, such as the cost does not depend on the size of
+// the trees but only on the depth of the path.
+static int
+fg_file_bydiffpath(fg_stats **out, git_repository *repo, const git_oid *baseOid, const git_oid *oid, const char *path)
+{
+  fg_tree_ref base = FG_TREE_REF_INIT;
+  fg_tree_ref tree = FG_TREE_REF_INIT;
+  const git_tree_entry *baseEntry = NULL;
+  const git_tree_entry *entry = NULL;
+  if (fg_tree_entry_bypath(&baseEntry, &base, repo, baseOid, path))
+    baseEntry = NULL;
+  if (fg_tree_entry_bypath(&entry, &tree, repo, oid, path))
+    entry = NULL;
+
+  int exit = -8;
+  if (baseEntry && entry &&
+      git_tree_entry_filemode(baseEntry) == git_tree_entry_filemode(entry) &&
+      git_oid_cmp(git_tree_entry_id(baseEntry), git_tree_entry_id(entry)) == 0) {
+    // Identical files are not part of the diff.
+    exit = -1;
+  } else if (baseEntry || entry) {
+    // Removed files are listed with their content in the base branch.
+    exit = fg_file_byentry(out, repo, entry ? entry : baseEntry);
+    if (exit == 0 && baseEntry && entry &&
+        git_tree_entry_filemode(baseEntry) == GIT_FILEMODE_TREE &&
+        git_tree_entry_filemode(entry) == GIT_FILEMODE_TREE) {
+      (*out)->hasBase = 1;
+      git_oid_cpy(&(*out)->base, git_tree_entry_id(baseEntry));
+    }
+  }
+
+  fg_tree_release(&tree);
+  fg_tree_release(&base);
+  return exit;
+}
+
+// Find a file located at <base>..<branch>/<path> under FG_DIFF_DIR.
+static int
+fg_file_bydiffspec(fg_stats **out, git_repository *repo, char *spec, char **object)
+{
+  char *dots = strstr(spec, "..");
+  if (!dots)
+    return -12;
+
+  // Branch names cannot contain "..", so the first one ends the base branch.
+  git_oid baseOid;
+  *dots = '\0';
+  int exit = fg_branch_tree(&baseOid, NULL, repo, spec);
+  *dots = '.';
+  if (exit)
+    return exit;
+
+  // Search the branch name, as done in fg_file_byrepo.
+  git_oid oid;
+  time_t last = 0;
+  char *branch = dots + 2;
+  char *path = branch;
+  int found = 0;
+  while (!found && (path = strchr(path, '/'))) {
+    *path = '\0';
+    found = fg_branch_tree(&oid, &last, repo, branch) == 0;
+    *path++ = '/';
+  }
+  if (!found) {
+    if (fg_branch_tree(&oid, &last, repo, branch))
+      return -1;
+    path = branch + strlen(branch);
+  }
+
+  if (path[0] == '\0') {
+    exit = fg_file_bytreeoid(out, repo, &oid);
+    if (exit == 0) {
+      (*out)->hasBase = 1;
+      git_oid_cpy(&(*out)->base, &baseOid);
+    }
+  } else {
+    exit = fg_file_bydiffpath(out, repo, &baseOid, &oid, path);
+  }
+
+  if (*out) {
+    fg_stats *result = *out;
+    result->stbuf.st_atime = last;
+    result->stbuf.st_mtime = last;
+    result->stbuf.st_ctime = last;
+  }
+
+  *object = path;
+  return exit;
+}
+
+static int
+fg_file_bydiff(fg_stats **out, git_repository *repo, const char *path)
+{
+  size_t len = strlen(path);
+  char *copy = strdup(path);
+  if (!copy)
+    return -3;
+
+  // Remove the trailing slash
+  if (copy[len - 1] == '/')
+    copy[len - 1] = '\0';
+
+  char *spec = copy + strlen(FG_DIFF_DIR);
+  if (spec[0] == '/')
+    spec += 1;
+
+  int exit = 0;
+  char *object = NULL;
+  if (spec[0] == '\0') {
+    // The diff directory itself, which is not listing anything as there is
+    // one sub-directory for each pair of branches.
+    fg_stats *result = calloc(1, sizeof(fg_stats));
+    result->stbuf.st_mode = S_IFDIR | 0555;
+    result->stbuf.st_nlink = 2;
+    *out = result;
+  } else {
+    exit = fg_file_bydiffspec(out, repo, spec, &object);
+  }
+
+  if (*out) {
+    fg_stats *result = *out;
+    result->path = copy;
+    result->object = object;
+    result->diff = 1;
+  } else {
+    free(copy);
+  }
+  return exit;
+}
+
 int
 fg_file_byrepo(fg_stats **out, git_repository *repo, const char *path)
 {
   size_t len = strlen(path);	
+  size_t diffLen = strlen(FG_DIFF_DIR);
+  if (strncmp(path, FG_DIFF_DIR, diffLen) == 0 &&
+      (path[diffLen] == '\0' || path[diffLen] == '/'))
+    return fg_file_bydiff(out, repo, path);
+
   char *branch = NULL;
   char *object = NULL;
 
@@ -356,6 +736,11 @@ int fg_file_has_oid(const fg_stats *file)
   return file->object != NULL;
 }
 
+int fg_file_is_diff(const fg_stats *file)
+{
+  return file->diff;
+}
+
 const git_oid *fg_file_oid(const fg_stats *file)
 {
   assert(fg_file_has_oid(file));
@@ -367,6 +752,72 @@ const struct stat *fg_file_stat(const fg_stats *file)
   return &file->stbuf;
 }
 
+static uint64_t
+fg_hash_str(uint64_t h, const char *str)
+{
+  // FNV-1a
+  for (; *str; str++) {
+    h ^= (unsigned char) *str;
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+static ino_t
+fg_oid_ino(const git_oid *oid)
+{
+  uint64_t ino = 0;
+  for (size_t i = 0; i < sizeof(ino); i++)
+    ino = (ino << 8) | oid->id[i];
+  return (ino_t) (ino >> 1);
+}
+
+// Hash of the path of the file in the emulated file system. Diff files carry
+// the whole path, and their object is a suffix of it.
+static uint64_t
+fg_file_path_hash(const fg_stats *file, int *trailingSlash)
+{
+  const char *path = file->path;
+  uint64_t h = fg_hash_str(0xcbf29ce484222325ULL, path);
+  *trailingSlash = path[0] != '\0' && path[strlen(path) - 1] == '/';
+  if (!file->diff && file->object && file->object[0] != '\0') {
+    h = fg_hash_str(h, "/");
+    h = fg_hash_str(h, file->object);
+    *trailingSlash = 0;
+  }
+  return h;
+}
+
+ino_t fg_file_ino(const fg_stats *file)
+{
+  // Files with the same content share their inode number, with the highest
+  // bit cleared.
+  if (fg_file_has_oid(file) &&
+      (S_ISREG(file->stbuf.st_mode) || S_ISLNK(file->stbuf.st_mode)))
+    return fg_oid_ino(&file->oid);
+
+  // Directories would be seen as loops if they were sharing their inode
+  // numbers, so they are identified by their path, with the highest bit set.
+  int trailingSlash = 0;
+  uint64_t h = fg_file_path_hash(file, &trailingSlash);
+  return (ino_t) (h | (1ULL << 63));
+}
+
+ino_t fg_file_child_ino(const fg_stats *dir, const char *relName, const git_oid *oid, git_filemode_t mode)
+{
+  if (oid && (mode == GIT_FILEMODE_BLOB || mode == GIT_FILEMODE_BLOB_EXECUTABLE ||
+              mode == GIT_FILEMODE_LINK))
+    return fg_oid_ino(oid);
+
+  // Hash the path of the entry, as fg_file_ino would do once it is resolved.
+  int trailingSlash = 0;
+  uint64_t h = fg_file_path_hash(dir, &trailingSlash);
+  if (!trailingSlash)
+    h = fg_hash_str(h, "/");
+  h = fg_hash_str(h, relName);
+  return (ino_t) (h | (1ULL << 63));
+}
+
 int
 fg_file_cpy(void *dest, git_repository *repo, const fg_stats *file, size_t fileOffset, size_t size)
 {
@@ -392,7 +843,8 @@ fg_file_list_tree(const char *root, const git_tree_entry *entry, void *payload)
 {
 	struct list_tree_payload *lt_payload = (struct list_tree_payload *) payload;
 	const char *name = git_tree_entry_name(entry);
-	if (lt_payload->callback(lt_payload->dir, lt_payload->repo, name, lt_payload->payload))
+	if (lt_payload->callback(lt_payload->dir, lt_payload->repo, name,
+				git_tree_entry_id(entry), git_tree_entry_filemode(entry), lt_payload->payload))
 		return -1;
 
 	// Skip deep traversal.
@@ -424,7 +876,7 @@ fg_file_list_branch(const char *branch, git_branch_t type, void *payload)
 		const char *slash = name;
 		slash = strchr(slash, '/');
 		if (slash == NULL) {
-			if (lt_payload->callback(lt_payload->dir, lt_payload->repo, name, lt_payload->payload))
+			if (lt_payload->callback(lt_payload->dir, lt_payload->repo, name, NULL, 0, lt_payload->payload))
 				return -1;
 		} else {
 			// Silent failure :(
@@ -436,13 +888,174 @@ fg_file_list_branch(const char *branch, git_branch_t type, void *payload)
 			strncpy(copy, name, len);
 			copy[len] = '\0';
 
-			if (lt_payload->callback(lt_payload->dir, lt_payload->repo, copy, lt_payload->payload))
+			if (lt_payload->callback(lt_payload->dir, lt_payload->repo, copy, NULL, 0, lt_payload->payload))
 				return -1;
 		}
 	}
 	return 0;
 }
 
+// Names of the entries which differ between two trees, cached per pair of
+// object identifiers. Each slot is selected by the identifiers.
+struct fg_diff_slot
+{
+	git_oid base;
+	git_oid oid;
+	// Sequence of entries, each made of the object identifier, the file mode and
+	// the null-terminated name, NULL if the slot is unused.
+	char *names;
+	size_t size;
+};
+
+static pthread_mutex_t fg_diff_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct fg_diff_slot fg_diff_slots[FG_DIFF_CACHE];
+
+static struct fg_diff_slot *
+fg_diff_slot(const git_oid *base, const git_oid *oid)
+{
+	size_t h = (((size_t) base->id[0] << 8) | base->id[1]) ^
+		(((size_t) oid->id[0] << 8) | oid->id[1]);
+	return &fg_diff_slots[h % FG_DIFF_CACHE];
+}
+
+// Copy the cached names of a pair of trees. Return 0 if found.
+static int
+fg_diff_cache_get(char **names, size_t *size, const git_oid *base, const git_oid *oid)
+{
+	int exit = 1;
+	pthread_mutex_lock(&fg_diff_lock);
+	struct fg_diff_slot *slot = fg_diff_slot(base, oid);
+	if (slot->names && git_oid_cmp(&slot->base, base) == 0 &&
+			git_oid_cmp(&slot->oid, oid) == 0) {
+		*names = malloc(slot->size ? slot->size : 1);
+		if (*names) {
+			memcpy(*names, slot->names, slot->size);
+			*size = slot->size;
+			exit = 0;
+		}
+	}
+	pthread_mutex_unlock(&fg_diff_lock);
+	return exit;
+}
+
+static void
+fg_diff_cache_put(const char *names, size_t size, const git_oid *base, const git_oid *oid)
+{
+	char *copy = malloc(size ? size : 1);
+	if (!copy)
+		return;
+	memcpy(copy, names, size);
+
+	pthread_mutex_lock(&fg_diff_lock);
+	struct fg_diff_slot *slot = fg_diff_slot(base, oid);
+	free(slot->names);
+	git_oid_cpy(&slot->base, base);
+	git_oid_cpy(&slot->oid, oid);
+	slot->names = copy;
+	slot->size = size;
+	pthread_mutex_unlock(&fg_diff_lock);
+}
+
+#define FG_DIFF_HEADER (sizeof(git_oid) + sizeof(git_filemode_t))
+
+static int
+fg_diff_append(char **names, size_t *size, size_t *capacity, const git_tree_entry *entry)
+{
+	const char *name = git_tree_entry_name(entry);
+	git_filemode_t mode = git_tree_entry_filemode(entry);
+	size_t len = strlen(name) + 1;
+	if (*size + FG_DIFF_HEADER + len > *capacity) {
+		size_t capacity2 = 2 * (*capacity) + FG_DIFF_HEADER + len;
+		char *names2 = realloc(*names, capacity2);
+		if (!names2)
+			return -1;
+		*names = names2;
+		*capacity = capacity2;
+	}
+	memcpy(*names + *size, git_tree_entry_id(entry), sizeof(git_oid));
+	memcpy(*names + *size + sizeof(git_oid), &mode, sizeof(mode));
+	memcpy(*names + *size + FG_DIFF_HEADER, name, len);
+	*size += FG_DIFF_HEADER + len;
+	return 0;
+}
+
+// Collect the entries which are added, modified or removed
+// between the base tree and the tree. Sub-trees are compared by their object
+// identifiers, without visiting them.
+static int
+fg_diff_names(char **names, size_t *size, git_repository *repo, const git_oid *baseOid, const git_oid *oid)
+{
+	fg_tree_ref base = FG_TREE_REF_INIT;
+	fg_tree_ref tree = FG_TREE_REF_INIT;
+	if (fg_tree_lookup(&base, repo, baseOid))
+		return -1;
+	if (fg_tree_lookup(&tree, repo, oid)) {
+		fg_tree_release(&base);
+		return -1;
+	}
+
+	size_t capacity = 0;
+	int error = 0;
+	*names = NULL;
+	*size = 0;
+
+	// Added and modified entries.
+	size_t count = git_tree_entrycount(tree.tree);
+	for (size_t i = 0; !error && i < count; i++) {
+		const git_tree_entry *entry = git_tree_entry_byindex(tree.tree, i);
+		const char *name = git_tree_entry_name(entry);
+		const git_tree_entry *baseEntry = git_tree_entry_byname(base.tree, name);
+		if (baseEntry &&
+				git_tree_entry_filemode(baseEntry) == git_tree_entry_filemode(entry) &&
+				git_oid_cmp(git_tree_entry_id(baseEntry), git_tree_entry_id(entry)) == 0)
+			continue;
+		error = fg_diff_append(names, size, &capacity, entry);
+	}
+
+	// Removed entries, listed with their content in the base branch.
+	count = git_tree_entrycount(base.tree);
+	for (size_t i = 0; !error && i < count; i++) {
+		const git_tree_entry *baseEntry = git_tree_entry_byindex(base.tree, i);
+		if (git_tree_entry_byname(tree.tree, git_tree_entry_name(baseEntry)))
+			continue;
+		error = fg_diff_append(names, size, &capacity, baseEntry);
+	}
+
+	fg_tree_release(&tree);
+	fg_tree_release(&base);
+	if (error) {
+		free(*names);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+fg_file_list_diff(const fg_stats *file, git_repository *repo, fg_list callback, void *payload)
+{
+	char *names = NULL;
+	size_t size = 0;
+	if (fg_diff_cache_get(&names, &size, &file->base, &file->oid)) {
+		if (fg_diff_names(&names, &size, repo, &file->base, &file->oid))
+			return -1;
+		fg_diff_cache_put(names, size, &file->base, &file->oid);
+	}
+
+	int error = 0;
+	for (size_t i = 0; !error && i < size; ) {
+		git_oid oid;
+		git_filemode_t mode;
+		memcpy(&oid, names + i, sizeof(oid));
+		memcpy(&mode, names + i + sizeof(oid), sizeof(mode));
+		const char *name = names + i + FG_DIFF_HEADER;
+		error = callback(file, repo, name, &oid, mode, payload);
+		i += FG_DIFF_HEADER + strlen(name) + 1;
+	}
+
+	free(names);
+	return error ? -2 : 0;
+}
+
 int
 fg_file_list(const fg_stats *file, git_repository *repo, fg_list callback, void *payload)
 {
@@ -454,18 +1067,24 @@ fg_file_list(const fg_stats *file, git_repository *repo, fg_list callback, void
 	};
 
 	// List relative directories.
-	callback(file, repo, ".", payload);
-	callback(file, repo, "..", payload);
-
-	if (fg_file_has_oid(file)) {
-		git_tree *tree = NULL;
-		if (git_tree_lookup(&tree, repo, fg_file_oid(file)))
+	callback(file, repo, ".", NULL, 0, payload);
+	callback(file, repo, "..", NULL, 0, payload);
+
+	if (fg_file_is_diff(file) && !fg_file_has_oid(file)) {
+		// Pairs of branches are not listed.
+		return 0;
+	} else if (file->hasBase) {
+		// List the differences with the base branch.
+		return fg_file_list_diff(file, repo, callback, payload);
+	} else if (fg_file_has_oid(file)) {
+		fg_tree_ref tree = FG_TREE_REF_INIT;
+		if (fg_tree_lookup(&tree, repo, fg_file_oid(file)))
 			return -1;
 
 		// List filenames in the tree.
-		int error = git_tree_walk(tree, &fg_file_list_tree, GIT_TREEWALK_PRE, &lt_payload);
+		int error = git_tree_walk(tree.tree, &fg_file_list_tree, GIT_TREEWALK_PRE, &lt_payload);
 
-		git_tree_free(tree);
+		fg_tree_release(&tree);
 		return (error < 0) ? -2 : 0;
 	} else {
 		// List branches under the current branch prefix.
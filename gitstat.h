@@ -4,6 +4,22 @@
 struct fg_stats;
 typedef struct fg_stats fg_stats;
 
+// Keep the most recently used trees alive, such as frequently visited trees
+// are not reconstructed from their delta chains on each lookup. This should be
+// called before any other function of this file.
+//
+// @param count Number of trees kept alive, 0 to disable the cache.
+//
+// @param maxBytes Upper bound of the memory used by the cached trees, which is
+// estimated from their number of entries. Trees which do not fit are not
+// cached.
+//
+// @return 0 or an error code.
+int fg_tree_cache_init(size_t count, size_t maxBytes);
+
+// Release the trees kept alive by the tree cache.
+void fg_tree_cache_free(void);
+
 // Free file stats.
 //
 // @param stats Stats to free.
@@ -33,6 +49,11 @@ int fg_file_is_branch_root(const fg_stats *file);
 // Non-zero if this file can be lookup in the git repository.
 int fg_file_has_oid(const fg_stats *file);
 
+// Non-zero if the file is located under the /@diff directory, which lists the
+// files which differ between two branches, as /@diff/<base>..<branch>/<path>.
+// Files which are removed in <branch> are listed with their <base> content.
+int fg_file_is_diff(const fg_stats *file);
+
 // Git object identifier corresponding to this file.
 //
 // The lifetime of this object identifer is bounded to the lifetime of the file.
@@ -45,6 +66,20 @@ const git_oid *fg_file_oid(const fg_stats *file);
 // The lifetime of this pointer is bounded to the lifetime of the file.
 const struct stat *fg_file_stat(const fg_stats *file);
 
+// Inode number of the file in the emulated filesystem. Files with the same
+// content have the same inode number, while directories have an inode number
+// derived from their path.
+ino_t fg_file_ino(const fg_stats *file);
+
+// Inode number of an entry listed in a directory, equal to the one returned by
+// fg_file_ino for the same file.
+//
+// @param dir  Parent directory used in fg_file_list.
+// @param relName  Name of the entry relative to the directory.
+// @param oid  Object identifier of the entry, or NULL if it has none.
+// @param mode  File mode of the entry, or 0 if it has none.
+ino_t fg_file_child_ino(const fg_stats *dir, const char *relName, const git_oid *oid, git_filemode_t mode);
+
 // Read a file content from an offset and for a specific size.
 int fg_file_cpy(void *dest, git_repository *repo, const fg_stats *file, size_t fileOffset, size_t size);
 
@@ -52,8 +87,12 @@ int fg_file_cpy(void *dest, git_repository *repo, const fg_stats *file, size_t f
 //
 // @param dir  Parent directory used in fg_file_list.
 // @param relName  Relative name of the file relative to the directory.
+// @param oid  Object identifier of the file, or NULL for relative directories
+//   and branches.
+// @param mode  File mode of the file in its tree, or 0 when oid is NULL.
 // @param payload  Untyped data transfered from fg_file_list.
-typedef int (*fg_list)(const fg_stats *dir, git_repository *repo, const char *relName, void *payload);
+typedef int (*fg_list)(const fg_stats *dir, git_repository *repo, const char *relName,
+                       const git_oid *oid, git_filemode_t mode, void *payload);
 
 // List files stored in a directory.  If the file is not a tree or a branch
 // prefix, then an error code is returned.
@@ -10,7 +10,8 @@ int print_oid(const char *prefix, const git_oid *oid) {
   return printf("%s oid: %s\n", prefix, git_oid_tostr(oidstr, -1, oid));
 }
 
-int listDir(const fg_stats *dir, git_repository *repo, const char *relName, void *payload){
+int listDir(const fg_stats *dir, git_repository *repo, const char *relName,
+            const git_oid *oid, git_filemode_t mode, void *payload){
   printf("\t%s\n", relName);
   return 0;
 }
@@ -21,6 +22,10 @@ main(int argc, char **argv)
   if (argc < 2)
     return -1;
 
+  // Cache trees as fusegitif does, such as queries have the same cost.
+  if (fg_tree_cache_init(1024, 32 << 20))
+    return -3;
+
   git_repository *repo;
   printf("Open repository %s\n", argv[1]);
   if (git_repository_open(&repo, argv[1]))
@@ -51,6 +56,7 @@ main(int argc, char **argv)
     fg_stats_free(file);
   }
 
+  fg_tree_cache_free();
   git_repository_free(repo);
   return 0;
 }
@@ -0,0 +1,54 @@
+#!/bin/sh
+#
+# Training workload used by the profile-guided optimization build. Generate a
+# synthetic repository with a few branches, then query every file of every
+# branch with lsR, such as the profile covers lookups, stats and listings.
+#
+# usage: pgo-train.sh <lsR> <workdir>
+
+set -e
+
+LSR=$1
+WORKDIR=$2
+: ${PGO_BRANCHES=8}
+: ${PGO_DIRS=16}
+: ${PGO_FILES=32}
+
+rm -rf "$WORKDIR"
+mkdir -p "$WORKDIR"
+cd "$WORKDIR"
+
+git init -q repo
+# Do not depend on the default branch name of the installed git.
+git -C repo symbolic-ref HEAD refs/heads/master
+cd repo
+git config user.name pgo
+git config user.email pgo@localhost
+
+# Create a tree with a few levels of directories and small files.
+for d in $(seq 1 $PGO_DIRS); do
+  mkdir -p "dir$d/sub$d"
+  for f in $(seq 1 $PGO_FILES); do
+    echo "file $d/$f" > "dir$d/file$f"
+    echo "nested $d/$f" > "dir$d/sub$d/file$f"
+  done
+done
+git add -A
+git commit -q -m "initial"
+
+# Each branch modifies a different subset of the tree.
+for b in $(seq 1 $PGO_BRANCHES); do
+  git checkout -q -b "topic/b$b" master
+  echo "branch $b" >> "dir$b/file1"
+  git commit -q -a -m "branch $b"
+done
+git checkout -q master
+
+# Query the root, the branch prefixes and every file of every branch.
+paths="/ /topic"
+for b in master $(git for-each-ref --format='%(refname:short)' refs/heads/topic); do
+  paths="$paths /$b"
+  paths="$paths $(git ls-tree -r -t --name-only "$b" | sed "s,^,/$b/,")"
+done
+
+"$LSR" "$WORKDIR/repo" $paths > /dev/null
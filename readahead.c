@@ -0,0 +1,489 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "gitstat.h"
+#include "blobcache.h"
+#include "readahead.h"
+
+// Number of directories which can be visited concurrently, such as a recursive
+// traversal does not lose track of the parent while visiting sub-directories.
+#define FG_RA_STREAMS 8
+
+// Number of consecutive entries opened before prefetching.
+#define FG_RA_TRIGGER 2
+
+// Maximum number of blobs queued or being inflated by the workers.
+#define FG_RA_INFLIGHT 64
+
+struct fg_ra_entry {
+  char *name;
+  git_oid oid;
+  int isBlob;
+};
+
+// Blob added to the cache by the readahead, and not opened yet.
+struct fg_ra_prefetched {
+  git_oid oid;
+  size_t size;
+  // Sequence of the stream which queued the blob.
+  unsigned long sequence;
+};
+
+// Blob waiting for a worker.
+struct fg_ra_queued {
+  git_oid oid;
+  unsigned long sequence;
+};
+
+// Listing of a directory, and position of the last opened entry.
+struct fg_ra_stream {
+  // Path of the directory without trailing slash, NULL if unused.
+  char *path;
+  git_oid tree;
+
+  struct fg_ra_entry *entries;
+  size_t count;
+
+  // Index of the last opened entry, or count if none.
+  size_t last;
+  // Number of entries opened consecutively.
+  unsigned streak;
+  // Index of the first entry which has not been queued yet.
+  size_t queued;
+  // Identifier of the current sequential visit, which owns the prefetched
+  // blobs. Renewed on random accesses and when the stream is replaced.
+  unsigned long sequence;
+
+  // Used to replace the least recently used stream.
+  unsigned long stamp;
+};
+
+struct fg_readahead {
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+
+  fg_blobcache *cache;
+  unsigned window;
+
+  struct fg_ra_stream streams[FG_RA_STREAMS];
+  unsigned long clock;
+  unsigned long sequences;
+
+  // Ring buffer of blobs waiting for a worker.
+  struct fg_ra_queued queue[FG_RA_INFLIGHT];
+  size_t head;
+  size_t len;
+  // Number of blobs taken by the workers.
+  unsigned inflight;
+
+  // Blobs prefetched and not opened yet. Their total size is bounded by a
+  // fraction of the cache, such as prefetched blobs are not evicting each
+  // other before being read.
+  struct fg_ra_prefetched prefetched[FG_RA_INFLIGHT];
+  size_t prefetchedCount;
+  size_t prefetchedBytes;
+  size_t budget;
+
+  int stop;
+  struct fg_ra_worker *threads;
+  // Number of allocated and of started workers.
+  unsigned capacity;
+  unsigned workers;
+};
+
+struct fg_ra_worker {
+  fg_readahead *ra;
+  pthread_t thread;
+  // Each worker has its own repository, such as blob lookups do not contend
+  // with the requests served by fuse.
+  git_repository *repo;
+};
+
+static void
+fg_ra_stream_clear(struct fg_ra_stream *stream)
+{
+  for (size_t i = 0; i < stream->count; i++)
+    free(stream->entries[i].name);
+  free(stream->entries);
+  free(stream->path);
+  memset(stream, 0, sizeof(struct fg_ra_stream));
+}
+
+struct fg_ra_accept_payload {
+  fg_readahead *ra;
+  unsigned long sequence;
+};
+
+// Non-zero if a stream is still visited by this sequence. Called with the lock
+// held.
+static int
+fg_ra_sequence_alive(const fg_readahead *ra, unsigned long sequence)
+{
+  for (size_t i = 0; i < FG_RA_STREAMS; i++) {
+    if (ra->streams[i].path && ra->streams[i].sequence == sequence)
+      return 1;
+  }
+  return 0;
+}
+
+// Accept a prefetched blob in the cache if it fits in the budget, and if the
+// sequence which queued it is still alive.
+static int
+fg_ra_accept(const git_oid *oid, size_t size, void *payload)
+{
+  struct fg_ra_accept_payload *ap = (struct fg_ra_accept_payload *) payload;
+  fg_readahead *ra = ap->ra;
+  pthread_mutex_lock(&ra->lock);
+  int accept = ra->prefetchedCount < FG_RA_INFLIGHT &&
+    ra->prefetchedBytes + size <= ra->budget &&
+    fg_ra_sequence_alive(ra, ap->sequence);
+  if (accept) {
+    struct fg_ra_prefetched *p = &ra->prefetched[ra->prefetchedCount++];
+    git_oid_cpy(&p->oid, oid);
+    p->size = size;
+    p->sequence = ap->sequence;
+    ra->prefetchedBytes += size;
+  }
+  pthread_mutex_unlock(&ra->lock);
+  return accept;
+}
+
+// Release the budget used by the blobs prefetched for a sequence, which are
+// left to the cache. Called with the lock held.
+static void
+fg_ra_release(fg_readahead *ra, unsigned long sequence)
+{
+  for (size_t i = 0; i < ra->prefetchedCount; ) {
+    if (ra->prefetched[i].sequence == sequence) {
+      ra->prefetchedBytes -= ra->prefetched[i].size;
+      ra->prefetched[i] = ra->prefetched[--ra->prefetchedCount];
+    } else {
+      i++;
+    }
+  }
+}
+
+// Release the budget used by a prefetched blob once it is opened. Called with
+// the lock held.
+static void
+fg_ra_consume(fg_readahead *ra, const git_oid *oid)
+{
+  for (size_t i = 0; i < ra->prefetchedCount; i++) {
+    if (git_oid_cmp(&ra->prefetched[i].oid, oid) == 0) {
+      ra->prefetchedBytes -= ra->prefetched[i].size;
+      ra->prefetched[i] = ra->prefetched[--ra->prefetchedCount];
+      return;
+    }
+  }
+}
+
+static void *
+fg_readahead_worker(void *payload)
+{
+  struct fg_ra_worker *worker = (struct fg_ra_worker *) payload;
+  fg_readahead *ra = worker->ra;
+  git_repository *repo = worker->repo;
+
+  pthread_mutex_lock(&ra->lock);
+  while (1) {
+    while (!ra->stop && ra->len == 0)
+      pthread_cond_wait(&ra->wake, &ra->lock);
+    if (ra->stop)
+      break;
+
+    git_oid oid;
+    git_oid_cpy(&oid, &ra->queue[ra->head].oid);
+    struct fg_ra_accept_payload ap = { ra, ra->queue[ra->head].sequence };
+    ra->head = (ra->head + 1) % FG_RA_INFLIGHT;
+    ra->len -= 1;
+    ra->inflight += 1;
+    pthread_mutex_unlock(&ra->lock);
+
+    // Reads of the same blob are waiting for this lookup.
+    if (!fg_blobcache_contains(ra->cache, &oid))
+      fg_blobcache_load(ra->cache, repo, &oid, &fg_ra_accept, &ap);
+
+    pthread_mutex_lock(&ra->lock);
+    ra->inflight -= 1;
+  }
+  pthread_mutex_unlock(&ra->lock);
+  return NULL;
+}
+
+int
+fg_readahead_new(fg_readahead **out, const char *repoName, fg_blobcache *cache,
+                 unsigned workers, unsigned window)
+{
+  fg_readahead *ra = calloc(1, sizeof(fg_readahead));
+  if (!ra)
+    return -1;
+
+  ra->threads = calloc(workers, sizeof(struct fg_ra_worker));
+  if (!ra->threads) {
+    free(ra);
+    return -1;
+  }
+
+  ra->capacity = workers;
+  ra->cache = cache;
+  ra->window = window;
+  // Half of the cache, as fg_blobcache_max_size is a quarter of it.
+  ra->budget = 2 * fg_blobcache_max_size(cache);
+  pthread_mutex_init(&ra->lock, NULL);
+  pthread_cond_init(&ra->wake, NULL);
+
+  // Open the repositories before starting any thread, such as a repository
+  // which cannot be opened is reported to the caller.
+  for (unsigned i = 0; i < workers; i++) {
+    ra->threads[i].ra = ra;
+    if (git_repository_open(&ra->threads[i].repo, repoName)) {
+      ra->threads[i].repo = NULL;
+      fg_readahead_free(ra);
+      return -3;
+    }
+  }
+
+  for (; ra->workers < workers; ra->workers++) {
+    struct fg_ra_worker *worker = &ra->threads[ra->workers];
+    if (pthread_create(&worker->thread, NULL, &fg_readahead_worker, worker)) {
+      fg_readahead_free(ra);
+      return -2;
+    }
+  }
+
+  *out = ra;
+  return 0;
+}
+
+void
+fg_readahead_free(fg_readahead *ra)
+{
+  if (!ra)
+    return;
+
+  pthread_mutex_lock(&ra->lock);
+  ra->stop = 1;
+  pthread_cond_broadcast(&ra->wake);
+  pthread_mutex_unlock(&ra->lock);
+  for (unsigned i = 0; i < ra->workers; i++)
+    pthread_join(ra->threads[i].thread, NULL);
+
+  for (size_t i = 0; i < FG_RA_STREAMS; i++)
+    fg_ra_stream_clear(&ra->streams[i]);
+
+  pthread_cond_destroy(&ra->wake);
+  pthread_mutex_destroy(&ra->lock);
+  // Repositories are opened before the workers are started.
+  for (unsigned i = 0; i < ra->capacity; i++)
+    git_repository_free(ra->threads[i].repo);
+  free(ra->threads);
+  free(ra);
+}
+
+// Length of the path without its trailing slash, such as "/" and "" are both
+// referring to the root.
+static size_t
+fg_ra_path_len(const char *path, size_t len)
+{
+  if (len > 0 && path[len - 1] == '/')
+    len -= 1;
+  return len;
+}
+
+static struct fg_ra_stream *
+fg_ra_stream_find(fg_readahead *ra, const char *path, size_t len)
+{
+  for (size_t i = 0; i < FG_RA_STREAMS; i++) {
+    struct fg_ra_stream *stream = &ra->streams[i];
+    if (stream->path && strlen(stream->path) == len &&
+        strncmp(stream->path, path, len) == 0)
+      return stream;
+  }
+  return NULL;
+}
+
+struct fg_ra_listing {
+  struct fg_ra_stream stream;
+  size_t capacity;
+  int error;
+};
+
+static int
+fg_ra_list_entry(const fg_stats *dir, git_repository *repo, const char *relName,
+                 const git_oid *oid, git_filemode_t mode, void *payload)
+{
+  struct fg_ra_listing *listing = (struct fg_ra_listing *) payload;
+  struct fg_ra_stream *stream = &listing->stream;
+  // Relative directories have no object.
+  if (!oid)
+    return 0;
+
+  if (stream->count == listing->capacity) {
+    size_t capacity = listing->capacity ? 2 * listing->capacity : 16;
+    struct fg_ra_entry *entries =
+      realloc(stream->entries, capacity * sizeof(struct fg_ra_entry));
+    if (!entries) {
+      listing->error = 1;
+      return -1;
+    }
+    stream->entries = entries;
+    listing->capacity = capacity;
+  }
+
+  struct fg_ra_entry *entry = &stream->entries[stream->count];
+  entry->name = strdup(relName);
+  if (!entry->name) {
+    listing->error = 1;
+    return -1;
+  }
+  git_oid_cpy(&entry->oid, oid);
+  entry->isBlob = mode == GIT_FILEMODE_BLOB || mode == GIT_FILEMODE_BLOB_EXECUTABLE;
+  stream->count += 1;
+  return 0;
+}
+
+void
+fg_readahead_readdir(fg_readahead *ra, git_repository *repo, const char *path, const fg_stats *dir)
+{
+  // Branch prefixes have no blobs to prefetch, and diff directories only list
+  // some of the entries of their tree.
+  if (!fg_file_has_oid(dir) || fg_file_is_diff(dir))
+    return;
+
+  size_t len = fg_ra_path_len(path, strlen(path));
+
+  pthread_mutex_lock(&ra->lock);
+  ra->clock += 1;
+  struct fg_ra_stream *stream = fg_ra_stream_find(ra, path, len);
+  if (stream && git_oid_cmp(&stream->tree, fg_file_oid(dir)) == 0) {
+    // Listing the same directory again, keep the current position.
+    stream->stamp = ra->clock;
+    pthread_mutex_unlock(&ra->lock);
+    return;
+  }
+  pthread_mutex_unlock(&ra->lock);
+
+  // Copy the entries outside the lock, in the order in which they are listed
+  // by fg_file_list. The tree was just listed, and is found in the tree cache.
+  struct fg_ra_listing listing;
+  memset(&listing, 0, sizeof(struct fg_ra_listing));
+  listing.stream.path = strndup(path, len);
+  if (!listing.stream.path ||
+      fg_file_list(dir, repo, &fg_ra_list_entry, &listing) ||
+      listing.error) {
+    fg_ra_stream_clear(&listing.stream);
+    return;
+  }
+
+  struct fg_ra_stream fresh = listing.stream;
+  git_oid_cpy(&fresh.tree, fg_file_oid(dir));
+  fresh.last = fresh.count;
+
+  pthread_mutex_lock(&ra->lock);
+  stream = fg_ra_stream_find(ra, path, len);
+  if (!stream) {
+    // Replace the least recently used stream.
+    stream = &ra->streams[0];
+    for (size_t i = 1; i < FG_RA_STREAMS; i++) {
+      if (ra->streams[i].stamp < stream->stamp)
+        stream = &ra->streams[i];
+    }
+  }
+  // Blobs prefetched for the replaced stream are left to the cache.
+  if (stream->path)
+    fg_ra_release(ra, stream->sequence);
+  fg_ra_stream_clear(stream);
+  *stream = fresh;
+  stream->stamp = ra->clock;
+  stream->sequence = ++ra->sequences;
+  pthread_mutex_unlock(&ra->lock);
+}
+
+// Index of the first blob after the entry at index i.
+static size_t
+fg_ra_next_blob(const struct fg_ra_stream *stream, size_t i)
+{
+  i = (i == stream->count) ? 0 : i + 1;
+  while (i < stream->count && !stream->entries[i].isBlob)
+    i++;
+  return i;
+}
+
+static int
+fg_ra_queued(const fg_readahead *ra, const git_oid *oid)
+{
+  for (size_t i = 0; i < ra->len; i++) {
+    if (git_oid_cmp(&ra->queue[(ra->head + i) % FG_RA_INFLIGHT].oid, oid) == 0)
+      return 1;
+  }
+  return 0;
+}
+
+void
+fg_readahead_open(fg_readahead *ra, const char *path)
+{
+  const char *slash = strrchr(path, '/');
+  if (!slash)
+    return;
+  const char *name = slash + 1;
+  size_t len = fg_ra_path_len(path, slash - path + 1);
+
+  pthread_mutex_lock(&ra->lock);
+  struct fg_ra_stream *stream = fg_ra_stream_find(ra, path, len);
+  if (!stream) {
+    pthread_mutex_unlock(&ra->lock);
+    return;
+  }
+  ra->clock += 1;
+  stream->stamp = ra->clock;
+
+  size_t i = fg_ra_next_blob(stream, stream->last);
+  if (i < stream->count && strcmp(stream->entries[i].name, name) == 0) {
+    stream->streak += 1;
+    fg_ra_consume(ra, &stream->entries[i].oid);
+  } else {
+    // Random access, find the entry to start a new sequence from it.
+    for (i = 0; i < stream->count; i++) {
+      if (strcmp(stream->entries[i].name, name) == 0)
+        break;
+    }
+    if (i == stream->count) {
+      pthread_mutex_unlock(&ra->lock);
+      return;
+    }
+    stream->streak = 1;
+    stream->queued = i + 1;
+    // Blobs prefetched for the previous sequence of this stream are left to
+    // the cache, without releasing the ones of other streams.
+    fg_ra_release(ra, stream->sequence);
+    stream->sequence = ++ra->sequences;
+  }
+  stream->last = i;
+
+  if (stream->streak < FG_RA_TRIGGER) {
+    pthread_mutex_unlock(&ra->lock);
+    return;
+  }
+
+  // Queue the blobs following the opened entry, within the in-flight budget.
+  size_t end = i + 1 + ra->window;
+  if (end > stream->count)
+    end = stream->count;
+  size_t j = (stream->queued > i + 1) ? stream->queued : i + 1;
+  for (; j < end && ra->len + ra->inflight < FG_RA_INFLIGHT &&
+         ra->prefetchedBytes < ra->budget; j++) {
+    const struct fg_ra_entry *entry = &stream->entries[j];
+    if (!entry->isBlob || fg_ra_queued(ra, &entry->oid))
+      continue;
+    struct fg_ra_queued *queued = &ra->queue[(ra->head + ra->len) % FG_RA_INFLIGHT];
+    git_oid_cpy(&queued->oid, &entry->oid);
+    queued->sequence = stream->sequence;
+    ra->len += 1;
+  }
+  stream->queued = j;
+
+  pthread_cond_broadcast(&ra->wake);
+  pthread_mutex_unlock(&ra->lock);
+}
@@ -0,0 +1,41 @@
+// Requires gitstat.h and blobcache.h to be included first.
+
+struct fg_readahead;
+typedef struct fg_readahead fg_readahead;
+
+// Start the readahead of blobs.
+//
+// Directory listings are recorded, and when files of the same directory are
+// opened in the listing order, the following blobs of the directory are
+// inflated into the cache by a pool of worker threads, ahead of their reads.
+//
+// @param out Pointer where to store the readahead state.
+//
+// @param repoName Path of the repository, opened once for each worker. This
+// should be an absolute path when called after fuse daemonized.
+//
+// @param cache Cache filled by the workers.
+//
+// @param workers Number of worker threads.
+//
+// @param window Number of blobs prefetched ahead of the last opened file.
+//
+// @return 0 or an error code.
+int fg_readahead_new(fg_readahead **out, const char *repoName, fg_blobcache *cache,
+                     unsigned workers, unsigned window);
+
+// Stop the worker threads and free the readahead state.
+void fg_readahead_free(fg_readahead *ra);
+
+// Record the listing of a directory.
+//
+// @param path Path of the directory in the emulated file system hierachy.
+//
+// @param dir Stats of the directory.
+void fg_readahead_readdir(fg_readahead *ra, git_repository *repo, const char *path, const fg_stats *dir);
+
+// Record the opening of a file, and queue the next blobs of the same directory
+// if the directory is visited sequentially.
+//
+// @param path Path of the file in the emulated file system hierachy.
+void fg_readahead_open(fg_readahead *ra, const char *path);
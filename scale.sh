@@ -0,0 +1,231 @@
+#!/bin/sh
+#
+# Check how queries made with the gitstat.c API scale. Generate one repository
+# for each point of each axis (number of branches, width and depth of trees,
+# size of blobs), and query it with lsR.
+#
+# For each point, the object identifiers and sizes reported by lsR are
+# compared against git ls-tree, and the time taken per queried path is
+# reported. For the branches, width and depth axes, the time per query of the
+# largest point must stay within a bounded ratio of the smallest point, such as
+# lookups which become linear in the size of the repository are reported.
+#
+# Exit with a non-zero status if any check fails.
+#
+# usage: scale.sh <lsR> <workdir> [branches|width|depth|blob]...
+
+set -e
+
+LSR=$1
+WORKDIR=$2
+shift 2
+# The default points are small enough for make check. Set SCALE_FULL=1 to
+# check up to 100000 branches and entries, and blobs of 1 GiB.
+if [ -n "$SCALE_FULL" ]; then
+  : ${SCALE_BRANCHES=10 100 1000 10000 100000}
+  : ${SCALE_WIDTH=10 100 1000 10000 100000}
+  : ${SCALE_DEPTH=1 10 50}
+  : ${SCALE_BLOB=1 1024 1048576 67108864 1073741824}
+else
+  : ${SCALE_BRANCHES=10 1000}
+  : ${SCALE_WIDTH=10 1000}
+  : ${SCALE_DEPTH=1 10}
+  : ${SCALE_BLOB=1 1048576}
+fi
+# Number of paths queried for each point. Each query of a blob inflates it,
+# so fewer queries are made on the blob axis.
+: ${SCALE_QUERIES=1000}
+: ${SCALE_BLOB_QUERIES=3}
+# Maximal ratio between the time per query of the largest and of the smallest
+# point of each axis.
+: ${SCALE_RATIO_BRANCHES=4}
+: ${SCALE_RATIO_WIDTH=4}
+: ${SCALE_RATIO_DEPTH=10}
+
+[ $# -gt 0 ] || set -- branches width depth blob
+
+mkdir -p "$WORKDIR"
+
+# Create an empty repository in $WORKDIR/$1, and move into it.
+new_repo() {
+  rm -rf "$WORKDIR/$1"
+  git init -q "$WORKDIR/$1"
+  cd "$WORKDIR/$1"
+  git symbolic-ref HEAD refs/heads/master
+  git config user.name scale
+  git config user.email scale@localhost
+}
+
+# Commit the index on master.
+commit_index() {
+  tree=$(git write-tree)
+  commit=$(echo scale | git commit-tree "$tree")
+  git update-ref refs/heads/master "$commit"
+}
+
+now() {
+  date +%s%N
+}
+
+# Print the object identifier and the size of each path listed in the file
+# $1, relative to the tree of master, as lsR is expected to report them.
+expected() {
+  git ls-tree -r -t -l master | awk -F'\t' '
+    NR == FNR {
+      split($1, f, " ");
+      entry[$2] = f[3] " " (f[2] == "tree" ? 4096 : f[4]);
+      next;
+    }
+    { print entry[$0]; }' - "$1"
+}
+
+# Print the object identifier and the size reported by lsR for each path found.
+reported() {
+  awk '
+    /^[^\t].* \[[0-9a-f]+\]$/ { oid = $NF; gsub(/[\[\]]/, "", oid); }
+    /^\tsize / { print oid " " $2; }' "$1"
+}
+
+# Query the paths given as arguments with lsR, check the results against the
+# relative paths listed in the file $3, and record the time per query in
+# nanoseconds. The first query is timed alone and subtracted, to exclude the
+# start-up of lsR and the loading of the references.
+measure() {
+  axis=$1
+  value=$2
+  relpaths=$3
+  shift 3
+  out="$WORKDIR/$axis-$value.out"
+
+  start=$(now)
+  "$LSR" "$(pwd)" "$1" > /dev/null
+  first=$(( $(now) - start ))
+  start=$(now)
+  "$LSR" "$(pwd)" "$@" > "$out"
+  all=$(( $(now) - start ))
+
+  queries=$(( $# > 1 ? $# - 1 : 1 ))
+  perquery=$(( (all - first) / queries ))
+  [ $perquery -gt 0 ] || perquery=1
+  echo "$value $perquery" >> "$WORKDIR/$axis.times"
+  echo "$axis $value $# $(( perquery / 1000 ))us/query"
+
+  expected "$relpaths" > "$out.expected"
+  reported "$out" > "$out.reported"
+  if ! diff -q "$out.expected" "$out.reported" > /dev/null; then
+    echo "FAIL: $axis $value: lsR results differ from git ls-tree, see $out" >&2
+    return 1
+  fi
+}
+
+# Check that the time per query of the last point of the axis is within a ratio
+# of the first point.
+check_ratio() {
+  axis=$1
+  ratio=$2
+  set -- $(head -n 1 "$WORKDIR/$axis.times") $(tail -n 1 "$WORKDIR/$axis.times")
+  if [ $(( $4 )) -gt $(( $2 * ratio )) ]; then
+    echo "FAIL: $axis: $(( $4 / 1000 ))us/query at $3 is more than $ratio times $(( $2 / 1000 ))us/query at $1" >&2
+    return 1
+  fi
+}
+
+branches() {
+  for n in $SCALE_BRANCHES; do
+    new_repo "branches-$n"
+    blob=$(echo content | git hash-object -w --stdin)
+    printf '100644 %s\tfile\n' "$blob" | git update-index --index-info
+    commit_index
+    seq 1 $n | sed "s,.*,create refs/heads/b& $commit," | git update-ref --stdin
+    git pack-refs --all
+
+    # All branches target the commit of master.
+    paths=""
+    : > "$WORKDIR/relpaths"
+    for i in $(seq 1 $SCALE_QUERIES); do
+      paths="$paths /b$(( (i * 7919) % n + 1 ))/file"
+      echo file >> "$WORKDIR/relpaths"
+    done
+    measure branches $n "$WORKDIR/relpaths" $paths || failed=1
+  done
+  check_ratio branches $SCALE_RATIO_BRANCHES || failed=1
+}
+
+width() {
+  for n in $SCALE_WIDTH; do
+    new_repo "width-$n"
+    # Give each file a different content, such as a lookup returning the wrong
+    # entry is noticed.
+    awk -v n=$n 'BEGIN {
+      print "commit refs/heads/master";
+      print "committer scale <scale@localhost> 0 +0000";
+      print "data 6"; print "scale";
+      for (i = 1; i <= n; i++) {
+        c = "content " i;
+        print "M 100644 inline dir/f" i;
+        print "data " (length(c) + 1); print c;
+      }
+    }' | git fast-import --quiet
+
+    paths="/master/dir"
+    echo dir > "$WORKDIR/relpaths"
+    for i in $(seq 1 $SCALE_QUERIES); do
+      f="f$(( (i * 7919) % n + 1 ))"
+      paths="$paths /master/dir/$f"
+      echo "dir/$f" >> "$WORKDIR/relpaths"
+    done
+    measure width $n "$WORKDIR/relpaths" $paths || failed=1
+  done
+  check_ratio width $SCALE_RATIO_WIDTH || failed=1
+}
+
+depth() {
+  for n in $SCALE_DEPTH; do
+    new_repo "depth-$n"
+    blob=$(echo content | git hash-object -w --stdin)
+    dir=$(seq 1 $n | sed 's,.*,d&,' | paste -sd/)
+    printf '100644 %s\t%s/file\n' "$blob" "$dir" | git update-index --index-info
+    commit_index
+
+    paths=""
+    : > "$WORKDIR/relpaths"
+    for i in $(seq 1 $SCALE_QUERIES); do
+      paths="$paths /master/$dir/file"
+      echo "$dir/file" >> "$WORKDIR/relpaths"
+    done
+    measure depth $n "$WORKDIR/relpaths" $paths || failed=1
+  done
+  check_ratio depth $SCALE_RATIO_DEPTH || failed=1
+}
+
+blob() {
+  for n in $SCALE_BLOB; do
+    new_repo "blob-$n"
+    blob=$(head -c $n /dev/urandom | git hash-object -w --stdin)
+    printf '100644 %s\tblob\n' "$blob" | git update-index --index-info
+    commit_index
+
+    paths=""
+    : > "$WORKDIR/relpaths"
+    for i in $(seq 1 $SCALE_BLOB_QUERIES); do
+      paths="$paths /master/blob"
+      echo blob >> "$WORKDIR/relpaths"
+    done
+    # Reading a blob is linear in its size, so only the results are checked.
+    measure blob $n "$WORKDIR/relpaths" $paths || failed=1
+  done
+}
+
+status=0
+for axis in "$@"; do
+  case "$axis" in
+    branches|width|depth|blob)
+      rm -f "$WORKDIR/$axis.times"
+      # Checks are failing through $failed, as set -e does not apply to
+      # commands whose status is tested.
+      ( failed=0; $axis; exit $failed ) || status=1
+      ;;
+    *) echo "scale.sh: unknown axis $axis" >&2; exit 1 ;;
+  esac
+done
+exit $status